@@ -0,0 +1,639 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/dfu/flash_img.h>
+#include <zephyr/dfu/mcuboot.h>
+#include <psa/crypto.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* Secondary slot (the download target, see V4 in README.md) */
+#define SECONDARY_AREA_ID FIXED_PARTITION_ID(slot1_partition)
+
+/*
+ * Compression parameters - heatshrink compatible LZSS bitstream
+ * (same format as `heatshrink -e -w 8 -l 4`). The window is the only
+ * history the decoder keeps, so it bounds the decompressor RAM. Like
+ * heatshrink, the window starts zero filled and may be referenced.
+ */
+#define HS_WINDOW_BITS    8
+#define HS_LOOKAHEAD_BITS 4
+#define HS_WINDOW_SIZE    (1U << HS_WINDOW_BITS)
+#define HS_LOOKAHEAD_SIZE (1U << HS_LOOKAHEAD_BITS)
+#define HS_MIN_MATCH      2  /* 13 bit backref beats two 9 bit literals */
+
+/* Simulated OTA link */
+#define OTA_IMAGE_SIZE    (32 * 1024)
+#define OTA_CHUNK_SIZE    256
+#define OTA_LINK_BPS      11520  /* 115200 baud UART, 8N1 */
+
+/* One chunk of the download as it arrives from the link */
+typedef struct {
+    uint8_t data[OTA_CHUNK_SIZE];
+    size_t len;                   /* 0 marks the end of the transfer */
+} ota_chunk_t;
+
+/* Message queue between the link (download thread) and the writer (main) */
+K_MSGQ_DEFINE(ota_chunk_queue, sizeof(ota_chunk_t), 8, 4);
+
+/* Signals the download thread to start sending the current payload */
+static K_SEM_DEFINE(download_start_sem, 0, 1);
+
+/* Payload currently "on the server" */
+static const uint8_t *download_data;
+static size_t download_len;
+
+/* Simulated server side: the image and its compressed form */
+static uint8_t server_image[OTA_IMAGE_SIZE];
+static uint8_t server_compressed[OTA_IMAGE_SIZE + OTA_IMAGE_SIZE / 8 + 1];
+static uint8_t server_image_hash[PSA_HASH_LENGTH(PSA_ALG_SHA_256)];
+
+/*
+ * Known answer vector: `heatshrink -e -w 8 -l 4` output for zero bytes
+ * followed by a repeated MCUboot magic. The leading zeros are a backref
+ * into the zero filled window. Worked out from the reference encoder
+ * (zero backlog, nearest match first, 2 byte minimum match).
+ */
+static const uint8_t hs_kat_plain[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x3d, 0xb8, 0xf3, 0x96, 0x3d, 0xb8, 0xf3, 0x96,
+};
+static const uint8_t hs_kat_compressed[] = {
+    0x00, 0x3c, 0xf7, 0x71, 0xf3, 0xcb, 0x00, 0xcc,
+};
+
+/* Output sink for decompressed data */
+typedef int (*hs_sink_t)(const uint8_t *data, size_t len, void *user_data);
+
+typedef enum {
+    HS_STATE_TAG,
+    HS_STATE_LITERAL,
+    HS_STATE_INDEX,
+    HS_STATE_COUNT,
+} hs_state_t;
+
+/* Streaming decoder - fixed RAM footprint, independent of image size */
+typedef struct {
+    uint8_t window[HS_WINDOW_SIZE];   /* Last HS_WINDOW_SIZE output bytes */
+    uint32_t head;
+    uint32_t pending;                 /* Window bytes not yet given to the sink */
+    uint32_t bit_acc;                 /* Bits carried over between chunks */
+    uint8_t bit_count;
+    uint16_t index;
+    hs_state_t state;
+    hs_sink_t sink;
+    void *user_data;
+} hs_decoder_t;
+
+/* Writer state for one update pass */
+typedef struct {
+    struct flash_img_context flash_ctx;
+    psa_hash_operation_t hash_op;
+    uint64_t write_cycles;            /* Flash write + hash time */
+} ota_writer_t;
+
+/* Per-pass statistics */
+typedef struct {
+    size_t wire_bytes;
+    size_t image_bytes;
+    uint64_t decode_cycles;
+    uint64_t write_cycles;
+    int64_t total_ms;
+} ota_stats_t;
+
+static ota_writer_t ota_writer;
+static hs_decoder_t hs_decoder;
+static ota_chunk_t ota_rx_chunk;
+
+/* ===== Simulated OTA server ===== */
+
+/*
+ * Synthetic test image: code, constant tables and erased padding. It is
+ * built to compress well, so the printed ratio only shows the mechanism
+ * works and says nothing about real images.
+ */
+static void server_build_image(void)
+{
+    uint32_t seed = 0x12345678;
+    size_t code_end = OTA_IMAGE_SIZE / 2;
+    size_t table_end = code_end + OTA_IMAGE_SIZE / 4;
+
+    for (size_t i = 0; i < code_end; i++) {
+        /* Small instruction alphabet gives code-like redundancy */
+        seed = seed * 1103515245 + 12345;
+        server_image[i] = (uint8_t)(0x40 + ((seed >> 16) & 0x0f));
+    }
+    for (size_t i = code_end; i < table_end; i++) {
+        server_image[i] = (uint8_t)(i & 0x3f);
+    }
+    memset(&server_image[table_end], 0xff, OTA_IMAGE_SIZE - table_end);
+}
+
+static void hs_put_bits(uint8_t *out, size_t *bit_pos, uint32_t value, uint8_t count)
+{
+    while (count--) {
+        size_t byte = *bit_pos >> 3;
+
+        if ((*bit_pos & 7) == 0) {
+            out[byte] = 0;
+        }
+        if (value & (1U << count)) {
+            out[byte] |= 0x80 >> (*bit_pos & 7);
+        }
+        (*bit_pos)++;
+    }
+}
+
+/* Byte before the start of the input reads as heatshrink's zero backlog */
+static uint8_t hs_backlog_byte(const uint8_t *in, size_t pos, size_t off)
+{
+    return (pos >= off) ? in[pos - off] : 0;
+}
+
+/* Greedy LZSS encoder - runs on the "server", speed is not a concern */
+static size_t server_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_cap)
+{
+    size_t bit_pos = 0;
+    size_t pos = 0;
+
+    while (pos < in_len) {
+        size_t max_len = MIN(in_len - pos, HS_LOOKAHEAD_SIZE);
+        size_t best_len = 0;
+        size_t best_off = 0;
+
+        for (size_t off = 1; off <= HS_WINDOW_SIZE && best_len < max_len; off++) {
+            size_t len = 0;
+
+            while (len < max_len &&
+                   in[pos + len] == hs_backlog_byte(in, pos + len, off)) {
+                len++;
+            }
+            if (len > best_len) {
+                best_len = len;
+                best_off = off;
+            }
+        }
+
+        /* Worst case symbol is 1 + window + lookahead bits */
+        if (((bit_pos + 1 + HS_WINDOW_BITS + HS_LOOKAHEAD_BITS + 7) >> 3) > out_cap) {
+            return 0;
+        }
+
+        if (best_len >= HS_MIN_MATCH) {
+            hs_put_bits(out, &bit_pos, 0, 1);
+            hs_put_bits(out, &bit_pos, best_off - 1, HS_WINDOW_BITS);
+            hs_put_bits(out, &bit_pos, best_len - 1, HS_LOOKAHEAD_BITS);
+            pos += best_len;
+        } else {
+            hs_put_bits(out, &bit_pos, 1, 1);
+            hs_put_bits(out, &bit_pos, in[pos], 8);
+            pos++;
+        }
+    }
+
+    /* Trailing bits of the last byte are zero - too short for any symbol */
+    return (bit_pos + 7) >> 3;
+}
+
+/* Download thread - pushes the payload through the queue at link speed */
+static void download_thread(void *p1, void *p2, void *p3)
+{
+    ota_chunk_t chunk;
+
+    while (1) {
+        k_sem_take(&download_start_sem, K_FOREVER);
+
+        printk("[DOWNLOAD] Sending %zu bytes at %d B/s\n", download_len, OTA_LINK_BPS);
+
+        for (size_t off = 0; off < download_len; off += chunk.len) {
+            chunk.len = MIN(download_len - off, OTA_CHUNK_SIZE);
+            memcpy(chunk.data, &download_data[off], chunk.len);
+
+            /* Simulate time on the wire */
+            k_sleep(K_USEC((uint64_t)chunk.len * USEC_PER_SEC / OTA_LINK_BPS));
+            k_msgq_put(&ota_chunk_queue, &chunk, K_FOREVER);
+        }
+
+        /* Zero length chunk marks end of transfer */
+        chunk.len = 0;
+        k_msgq_put(&ota_chunk_queue, &chunk, K_FOREVER);
+    }
+}
+
+/* ===== Device side: streaming decompressor ===== */
+
+static void hs_decoder_init(hs_decoder_t *dec, hs_sink_t sink, void *user_data)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->state = HS_STATE_TAG;
+    dec->sink = sink;
+    dec->user_data = user_data;
+}
+
+/* Read count bits MSB first, returns false if the chunk ran out */
+static bool hs_get_bits(hs_decoder_t *dec, const uint8_t **in, const uint8_t *end,
+                        uint8_t count, uint16_t *value)
+{
+    while (dec->bit_count < count) {
+        if (*in == end) {
+            return false;
+        }
+        dec->bit_acc = (dec->bit_acc << 8) | *(*in)++;
+        dec->bit_count += 8;
+    }
+
+    dec->bit_count -= count;
+    *value = (dec->bit_acc >> dec->bit_count) & ((1U << count) - 1);
+    dec->bit_acc &= (1U << dec->bit_count) - 1;
+    return true;
+}
+
+/* Hand pending output to the sink straight from the window (two runs if it wraps) */
+static int hs_flush(hs_decoder_t *dec)
+{
+    uint32_t start = (dec->head - dec->pending) & (HS_WINDOW_SIZE - 1);
+    uint32_t first = MIN(dec->pending, HS_WINDOW_SIZE - start);
+    int ret = 0;
+
+    if (first > 0) {
+        ret = dec->sink(&dec->window[start], first, dec->user_data);
+    }
+    if (ret == 0 && dec->pending > first) {
+        ret = dec->sink(dec->window, dec->pending - first, dec->user_data);
+    }
+    dec->pending = 0;
+    return ret;
+}
+
+static int hs_emit(hs_decoder_t *dec, uint8_t c)
+{
+    int ret;
+
+    /* Flush before the oldest pending byte gets overwritten */
+    if (dec->pending == HS_WINDOW_SIZE) {
+        ret = hs_flush(dec);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    dec->window[dec->head++ & (HS_WINDOW_SIZE - 1)] = c;
+    dec->pending++;
+    return 0;
+}
+
+/* Feed one chunk of compressed data, output goes to the sink */
+static int hs_decoder_feed(hs_decoder_t *dec, const uint8_t *data, size_t len)
+{
+    const uint8_t *end = data + len;
+    uint16_t value;
+    int ret;
+
+    while (1) {
+        switch (dec->state) {
+        case HS_STATE_TAG:
+            if (!hs_get_bits(dec, &data, end, 1, &value)) {
+                return 0;
+            }
+            dec->state = value ? HS_STATE_LITERAL : HS_STATE_INDEX;
+            break;
+
+        case HS_STATE_LITERAL:
+            if (!hs_get_bits(dec, &data, end, 8, &value)) {
+                return 0;
+            }
+            ret = hs_emit(dec, (uint8_t)value);
+            if (ret != 0) {
+                return ret;
+            }
+            dec->state = HS_STATE_TAG;
+            break;
+
+        case HS_STATE_INDEX:
+            if (!hs_get_bits(dec, &data, end, HS_WINDOW_BITS, &dec->index)) {
+                return 0;
+            }
+            dec->state = HS_STATE_COUNT;
+            break;
+
+        case HS_STATE_COUNT:
+            if (!hs_get_bits(dec, &data, end, HS_LOOKAHEAD_BITS, &value)) {
+                return 0;
+            }
+
+            /* Byte by byte so overlapping references repeat correctly */
+            for (uint16_t i = 0; i <= value; i++) {
+                ret = hs_emit(dec, dec->window[(dec->head - dec->index - 1) &
+                                                (HS_WINDOW_SIZE - 1)]);
+                if (ret != 0) {
+                    return ret;
+                }
+            }
+            dec->state = HS_STATE_TAG;
+            break;
+        }
+    }
+}
+
+/* End of stream - flush pending output and check only padding is left */
+static int hs_decoder_finish(hs_decoder_t *dec)
+{
+    if (dec->bit_acc != 0 ||
+        (dec->state != HS_STATE_TAG && dec->state != HS_STATE_INDEX)) {
+        return -EBADMSG;
+    }
+    return hs_flush(dec);
+}
+
+/* ===== Device side: secondary slot writer ===== */
+
+/* Sink - hashes and writes decompressed image data to the secondary slot */
+static int ota_writer_sink(const uint8_t *data, size_t len, void *user_data)
+{
+    ota_writer_t *writer = user_data;
+    uint32_t start = k_cycle_get_32();
+    int ret;
+
+    /* Hash the image as it lands in flash so VAL5/VAL7 see the same bytes */
+    if (psa_hash_update(&writer->hash_op, data, len) != PSA_SUCCESS) {
+        return -EIO;
+    }
+
+    ret = flash_img_buffered_write(&writer->flash_ctx, data, len, false);
+
+    writer->write_cycles += k_cycle_get_32() - start;
+    return ret;
+}
+
+static int ota_writer_begin(ota_writer_t *writer)
+{
+    int ret;
+
+    memset(writer, 0, sizeof(*writer));
+
+#if !defined(CONFIG_IMG_ERASE_PROGRESSIVELY)
+    /* Erase secondary slot sectors up front (W1) */
+    ret = boot_erase_img_bank(SECONDARY_AREA_ID);
+    if (ret != 0) {
+        printk("✗ Failed to erase secondary slot: %d\n", ret);
+        return ret;
+    }
+#endif
+
+    ret = flash_img_init_id(&writer->flash_ctx, SECONDARY_AREA_ID);
+    if (ret != 0) {
+        printk("✗ Failed to open secondary slot: %d\n", ret);
+        return ret;
+    }
+
+    writer->hash_op = psa_hash_operation_init();
+    if (psa_hash_setup(&writer->hash_op, PSA_ALG_SHA_256) != PSA_SUCCESS) {
+        printk("✗ Failed to start image hash\n");
+        psa_hash_abort(&writer->hash_op);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/* Flush the writer and compare the image hash with the server manifest */
+static int ota_writer_end(ota_writer_t *writer)
+{
+    uint8_t hash[PSA_HASH_LENGTH(PSA_ALG_SHA_256)];
+    size_t hash_len;
+    int ret;
+
+    ret = flash_img_buffered_write(&writer->flash_ctx, NULL, 0, true);
+    if (ret != 0) {
+        printk("✗ Final flash write failed: %d\n", ret);
+        return ret;
+    }
+
+    if (psa_hash_finish(&writer->hash_op, hash, sizeof(hash), &hash_len) != PSA_SUCCESS) {
+        printk("✗ Failed to finish image hash\n");
+        return -EIO;
+    }
+
+    if (memcmp(hash, server_image_hash, sizeof(hash)) != 0) {
+        printk("✗ Image hash mismatch\n");
+        return -EBADMSG;
+    }
+
+    printk("✓ Image hash matches (%zu bytes written)\n",
+           flash_img_bytes_written(&writer->flash_ctx));
+    return 0;
+}
+
+/* Run one update: download, (decompress), write secondary slot, verify */
+static int ota_update(const uint8_t *payload, size_t payload_len, bool compressed,
+                      ota_stats_t *stats)
+{
+    int64_t start_ms;
+    uint32_t start;
+    int ret;
+
+    memset(stats, 0, sizeof(*stats));
+    start_ms = k_uptime_get();
+
+    ret = ota_writer_begin(&ota_writer);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (compressed) {
+        hs_decoder_init(&hs_decoder, ota_writer_sink, &ota_writer);
+    }
+
+    download_data = payload;
+    download_len = payload_len;
+    k_sem_give(&download_start_sem);
+
+    while (1) {
+        k_msgq_get(&ota_chunk_queue, &ota_rx_chunk, K_FOREVER);
+
+        /* Keep draining on error so the download thread never blocks */
+        if (ota_rx_chunk.len == 0) {
+            break;
+        }
+        if (ret != 0) {
+            continue;
+        }
+        stats->wire_bytes += ota_rx_chunk.len;
+
+        if (compressed) {
+            start = k_cycle_get_32();
+            ret = hs_decoder_feed(&hs_decoder, ota_rx_chunk.data, ota_rx_chunk.len);
+            stats->decode_cycles += k_cycle_get_32() - start;
+        } else {
+            ret = ota_writer_sink(ota_rx_chunk.data, ota_rx_chunk.len, &ota_writer);
+        }
+
+        if (ret != 0) {
+            printk("✗ Update failed at offset %zu: %d\n", stats->wire_bytes, ret);
+        }
+    }
+
+    if (ret == 0 && compressed) {
+        start = k_cycle_get_32();
+        ret = hs_decoder_finish(&hs_decoder);
+        stats->decode_cycles += k_cycle_get_32() - start;
+    }
+    if (ret == 0) {
+        ret = ota_writer_end(&ota_writer);
+    }
+    if (ret != 0) {
+        /* No-op if the hash already finished, otherwise releases it */
+        psa_hash_abort(&ota_writer.hash_op);
+    }
+
+    stats->image_bytes = flash_img_bytes_written(&ota_writer.flash_ctx);
+    stats->write_cycles = ota_writer.write_cycles;
+    /* Sink time was measured inside the decoder calls, take it out again */
+    if (compressed) {
+        stats->decode_cycles -= MIN(stats->decode_cycles, stats->write_cycles);
+    }
+    stats->total_ms = k_uptime_get() - start_ms;
+
+    return ret;
+}
+
+static void ota_print_stats(const char *name, const ota_stats_t *stats)
+{
+    uint64_t decode_us = k_cyc_to_us_floor64(stats->decode_cycles);
+    uint64_t write_us = k_cyc_to_us_floor64(stats->write_cycles);
+
+    printk("=== %s UPDATE ===\n", name);
+    printk("Wire bytes: %zu, image bytes: %zu\n", stats->wire_bytes, stats->image_bytes);
+    if (stats->wire_bytes > 0) {
+        uint32_t ratio = (uint32_t)((uint64_t)stats->image_bytes * 100 / stats->wire_bytes);
+
+        printk("Compression ratio: %u.%02u:1\n", ratio / 100, ratio % 100);
+    }
+    if (decode_us > 0) {
+        printk("Decompression: %" PRIu64 " us (%" PRIu64 " KB/s)\n", decode_us,
+               (uint64_t)stats->image_bytes * USEC_PER_SEC / decode_us / 1024);
+    } else {
+        /* native_sim runs code in zero simulated time, see README.md */
+        printk("Decompression: n/a (no cycles elapsed on this target)\n");
+    }
+    printk("Flash write + hash: %" PRIu64 " us\n", write_us);
+    printk("Total update time: %" PRId64 " ms\n", stats->total_ms);
+    printk("========================================\n");
+}
+
+/* Sink for the known answer test - compares against hs_kat_plain */
+static int hs_kat_sink(const uint8_t *data, size_t len, void *user_data)
+{
+    size_t *offset = user_data;
+
+    if (*offset + len > sizeof(hs_kat_plain) ||
+        memcmp(data, &hs_kat_plain[*offset], len) != 0) {
+        return -EBADMSG;
+    }
+    *offset += len;
+    return 0;
+}
+
+/* Check decoder and encoder against the heatshrink known answer vector */
+static int hs_self_test(void)
+{
+    uint8_t out[sizeof(hs_kat_compressed)];
+    size_t offset = 0;
+    int ret;
+
+    /* Feed one byte at a time to exercise state kept across chunks */
+    hs_decoder_init(&hs_decoder, hs_kat_sink, &offset);
+    for (size_t i = 0; i < sizeof(hs_kat_compressed); i++) {
+        ret = hs_decoder_feed(&hs_decoder, &hs_kat_compressed[i], 1);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    ret = hs_decoder_finish(&hs_decoder);
+    if (ret != 0 || offset != sizeof(hs_kat_plain)) {
+        return -EBADMSG;
+    }
+
+    if (server_compress(hs_kat_plain, sizeof(hs_kat_plain), out, sizeof(out)) !=
+            sizeof(hs_kat_compressed) ||
+        memcmp(out, hs_kat_compressed, sizeof(out)) != 0) {
+        return -EBADMSG;
+    }
+
+    return 0;
+}
+
+K_THREAD_DEFINE(download, 1024, download_thread, NULL, NULL, NULL,
+                K_PRIO_PREEMPT(5), 0, 0);  /* Simulated link */
+
+int main(void)
+{
+    ota_stats_t raw_stats;
+    ota_stats_t lz_stats;
+    struct mcuboot_img_header slot_header;
+    size_t compressed_len;
+    size_t hash_len;
+    int ret;
+
+    printk("=== MCUboot Compressed Image Update ===\n");
+
+    if (psa_crypto_init() != PSA_SUCCESS) {
+        printk("✗ PSA crypto init failed\n");
+        return -1;
+    }
+
+    ret = hs_self_test();
+    if (ret != 0) {
+        printk("✗ Heatshrink known answer test failed: %d\n", ret);
+        return ret;
+    }
+    printk("✓ Heatshrink known answer test passed\n");
+
+    /* Server side: build image, publish its hash and a compressed copy */
+    server_build_image();
+    if (psa_hash_compute(PSA_ALG_SHA_256, server_image, sizeof(server_image),
+                         server_image_hash, sizeof(server_image_hash),
+                         &hash_len) != PSA_SUCCESS) {
+        printk("✗ Image hash failed\n");
+        return -1;
+    }
+
+    compressed_len = server_compress(server_image, sizeof(server_image),
+                                     server_compressed, sizeof(server_compressed));
+    if (compressed_len == 0) {
+        printk("✗ Compression failed\n");
+        return -1;
+    }
+    printk("✓ Server image ready: %zu bytes, %zu compressed\n",
+           sizeof(server_image), compressed_len);
+    printk("Decoder RAM: %zu bytes (window %u)\n", sizeof(hs_decoder_t), HS_WINDOW_SIZE);
+
+    /* Baseline - uncompressed image written as it arrives */
+    ret = ota_update(server_image, sizeof(server_image), false, &raw_stats);
+    if (ret != 0) {
+        printk("✗ Uncompressed update failed: %d\n", ret);
+        return ret;
+    }
+    ota_print_stats("UNCOMPRESSED", &raw_stats);
+
+    /* Compressed image decompressed straight into the secondary slot */
+    ret = ota_update(server_compressed, compressed_len, true, &lz_stats);
+    if (ret != 0) {
+        printk("✗ Compressed update failed: %d\n", ret);
+        return ret;
+    }
+    ota_print_stats("COMPRESSED", &lz_stats);
+
+    printk("Update time saved: %" PRId64 " ms\n", raw_stats.total_ms - lz_stats.total_ms);
+
+    /* Only mark for swap if the slot holds a valid MCUboot header (VAL1/VAL2) */
+    ret = boot_read_bank_header(SECONDARY_AREA_ID, &slot_header, sizeof(slot_header));
+    if (ret == 0) {
+        ret = boot_request_upgrade(BOOT_UPGRADE_TEST);
+        printk("Secondary slot marked PENDING: %d\n", ret);
+    } else {
+        printk("No MCUboot header in secondary slot (%d) - not requesting swap\n", ret);
+    }
+
+    return 0;
+}